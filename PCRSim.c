@@ -5,10 +5,14 @@
   Finding PCR primer matches in a genome.
 */
 
+#define _POSIX_C_SOURCE 200809L  // mkstemp(), fdopen()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <unistd.h>
 #include "PCRSim.h"
 #include "jmg_utils.h"
 
@@ -31,11 +35,34 @@ void usage(void) {
   fprintf(stderr, "                     NOTE: Both primers should be given with respect to the plus\n");
   fprintf(stderr, "                       strand, i.e. the sequence given for the reverse primer is\n");
   fprintf(stderr, "                       the reverse-complement of actual reverse primer\n");
+  fprintf(stderr, "                     For nested PCR, give %s once per round: the primers\n", PRIMFILE);
+  fprintf(stderr, "                       of each round are matched only within the products\n");
+  fprintf(stderr, "                       of the previous round, and an extra output column\n");
+  fprintf(stderr, "                       lists the outer products of each final product.\n");
+  fprintf(stderr, "                       The amplicon lengths (%s, %s) apply to every round,\n", MINLEN, MAXLEN);
+  fprintf(stderr, "                       so %s must allow the shortest inner product, and\n", MINLEN);
+  fprintf(stderr, "                       %s cannot exceed %d\n", MAXLEN, CHUNK_SIZE / 2);
   fprintf(stderr, "  %s  <file>       Output file for primer-genome matches\n", OUTFILE);
   fprintf(stderr, "Optional parameters:\n");
   fprintf(stderr, "  %s  <int>        Minimum amplicon length (def. %d)\n", MINLEN, DEFMIN);
   fprintf(stderr, "  %s  <int>        Maximum amplicon length (def. %d)\n", MAXLEN, DEFMAX);
   fprintf(stderr, "  %s  <float>      Minimum primer-genome match score (in (0-1]; def. %.2f)\n", MINSCORE, DEFSCORE);
+  fprintf(stderr, "  %s  <float>      Weight applied to match scores of primers lying within\n", MASKWT);
+  fprintf(stderr, "                     soft-masked (lowercase) regions of the genome (in [0,1];\n");
+  fprintf(stderr, "                     def. %.2f). A weight of 0 skips these regions entirely\n", DEFMASK);
+  fprintf(stderr, "  %s  <int>        Number of amplicons to report per primer pair, ranked\n", TOPK);
+  fprintf(stderr, "                     by combined primer score, then by closeness to the\n");
+  fprintf(stderr, "                     target length (def. %d = report all). For nested PCR,\n", DEFTOPK);
+  fprintf(stderr, "                     this applies to the final round only: all products\n");
+  fprintf(stderr, "                     of earlier rounds are searched by the next round\n");
+  fprintf(stderr, "  %s  <int>        Target amplicon length for ranking (def. midpoint of\n", TARGET);
+  fprintf(stderr, "                     min. and max. lengths)\n");
+  fprintf(stderr, "  %s <file>       Output file for histograms of amplicon counts per\n", HISTFILE);
+  fprintf(stderr, "                     primer pair, by mean score and by length\n");
+  fprintf(stderr, "  %s  <int>        Sort the output by chromosome (in the order of the fasta\n", SORTMEM);
+  fprintf(stderr, "                     file) and coordinates, removing duplicates, using at\n");
+  fprintf(stderr, "                     most this much memory (MB) for amplicons; beyond it,\n");
+  fprintf(stderr, "                     sorted runs are kept on disk in $TMPDIR (def. /tmp)\n");
 
   fprintf(stderr, "  %s  <file>       Log file for stitching results\n", LOGFILE);
   fprintf(stderr, "  %s               Option to check for dovetailing of the reads\n", DOVEOPT);
@@ -49,6 +76,20 @@ void usage(void) {
 }
 
 
+/* void freeMatches()
+ * Frees a list of matches.
+ */
+void freeMatches(Match** head) {
+  Match* temp;
+  for (Match* m = *head; m != NULL; ) {
+    temp = m;
+    m = m->next;
+    free(temp->seq);
+    free(temp);
+  }
+  *head = NULL;
+}
+
 /* void freeMemory()
  * Frees allocated memory.
  */
@@ -58,6 +99,13 @@ void freeMemory(Primer* head) {
     free(p->name);
     for (int i = 0; i < 4; i++)
       free(p->seq[i]);
+    freeMatches(&p->first);
+    freeMatches(&p->amp);
+    for (int i = 0; i < p->nheap; i++) {
+      free(p->heap[i]->seq);
+      free(p->heap[i]);
+    }
+    free(p->heap);
     temp = p;
     p = p->next;
     free(temp);
@@ -213,10 +261,45 @@ void printFail(FILE* un1, FILE* un2, FILE* log,
   }
 }
 
+/* void addInt()
+ * Extends the last interval of a list to include the given
+ *   position, or appends a new interval.
+ */
+void addInt(Interval** head, Interval** tail, int pos) {
+  if (*tail != NULL && (*tail)->end == pos) {
+    (*tail)->end++;
+    return;
+  }
+  Interval* iv = (Interval*) memalloc(sizeof(Interval));
+  iv->start = pos;
+  iv->end = pos + 1;
+  iv->next = NULL;
+  if (*head == NULL)
+    *head = iv;
+  else
+    (*tail)->next = iv;
+  *tail = iv;
+}
+
+/* void trimInt()
+ * Removes intervals that end at or before the given position.
+ */
+void trimInt(Interval** head, Interval** tail, int pos) {
+  while (*head != NULL && (*head)->end <= pos) {
+    Interval* temp = *head;
+    *head = temp->next;
+    free(temp);
+  }
+  if (*head == NULL)
+    *tail = NULL;
+}
+
 /* int getChunk()
- * Loads the next chunk from the genome.
+ * Loads the next chunk from the genome. Runs of Ns and
+ *   (optionally) soft-masked bases are recorded as intervals.
  */
-int getChunk(char* chunk, int pos, FILE* gen) {
+int getChunk(char* chunk, int pos, FILE* gen, Chrom* c,
+    int soft) {
   int i = 0;
 
   // copy piece from 3' end
@@ -230,89 +313,857 @@ int getChunk(char* chunk, int pos, FILE* gen) {
     if (ch == EOF) {
       // end of file
       chunk[i] = '\0';
+      line[0] = '\0';
       return 0;
     } else if (ch == '>') {
       // next chromosome
       chunk[i] = '\0';
-      getLine(line + 1, MAX_SIZE, gen);
+      getLine(line + 1, MAX_SIZE - 1, gen);
       return 0;
-    } else if (ch != '\n')
+    } else if (ch != '\n') {
+      if (ch == 'N' || ch == 'n')
+        addInt(&c->gap, &c->gapEnd, c->len);
+      if (soft && islower(ch))
+        addInt(&c->mask, &c->maskEnd, c->len);
       chunk[i++] = toupper(ch);
+      c->len++;
+    }
   }
   chunk[i] = '\0';
   return 1;
 }
 
+/* int weight()
+ * Returns the weight of a primer position (counted from
+ *   the 5' end). Positions near the 3' end count most.
+ */
+int weight(int len, int i) {
+  int val = 21 - len + i;
+  if (val > 19)
+    val *= 5;
+  else if (val > 10)
+    val *= 3;
+  else if (val > 0)
+    val *= 2;
+  else
+    val = 1;
+  return val;
+}
+
+/* Bit sets for baseMatch(): the bases each primer code
+ *   matches, and the genome bases (other codes are 0 and
+ *   match only an N in the primer).
+ */
+static const unsigned char primBits[256] = {
+  ['A'] = 1, ['C'] = 2, ['G'] = 4, ['T'] = 8,
+  ['R'] = 5, ['Y'] = 10, ['S'] = 6, ['W'] = 9, ['K'] = 12,
+  ['M'] = 3, ['B'] = 14, ['D'] = 13, ['H'] = 11, ['V'] = 7
+};
+static const unsigned char genBits[256] = {
+  ['A'] = 1, ['C'] = 2, ['G'] = 4, ['T'] = 8
+};
+
+/* int baseMatch()
+ * Checks a primer base against a genome base, allowing
+ *   ambiguous primer bases (same result as !ambig()).
+ */
+static inline int baseMatch(char x, char y) {
+  return x == y || x == 'N' || (primBits[(unsigned char) x]
+    & genBits[(unsigned char) y]);
+}
+
+/* float scorePrim()
+ * Calculates the weighted primer-genome match score. Returns 0
+ *   as soon as the mismatches exceed the allowed weight.
+ */
+float scorePrim(char* prim, char* gen, int len, int max,
+    int rev, float allow) {
+  int mis = 0;
+  for (int i = 0; i < len; i++)
+    if (!baseMatch(prim[i], gen[i])) {
+      mis += weight(len, rev ? len - 1 - i : i);
+      if (mis > allow)
+        return 0.0f;
+    }
+  return (float) (max - mis) / max;
+}
+
+/* float scoreFwd(), scoreRev()
+ * Generic kernels for primers with the 3' end on the
+ *   right (scoreFwd) or left (scoreRev).
+ */
+float scoreFwd(char* prim, char* gen, int len, int max,
+    float allow) {
+  return scorePrim(prim, gen, len, max, 0, allow);
+}
+float scoreRev(char* prim, char* gen, int len, int max,
+    float allow) {
+  return scorePrim(prim, gen, len, max, 1, allow);
+}
+
+/* Specialized kernels
+ * Versions of scoreFwd() and scoreRev() for each primer length
+ *   in [MINKERN,MAXKERN], fully unrolled with the position
+ *   weights of weight() as constants. The len argument is
+ *   unused (the length is fixed).
+ */
+#define WVAL(L, i)    (21 - (L) + (i))
+#define WEIGHT(L, i)  (WVAL(L, i) > 19 ? 5 * WVAL(L, i) : \
+  WVAL(L, i) > 10 ? 3 * WVAL(L, i) : WVAL(L, i) > 0 ? 2 * WVAL(L, i) : 1)
+#define KERNEL(L, NAME, IDX) \
+  float NAME(char* prim, char* gen, int len, int max, \
+      float allow) { \
+    (void) len; \
+    int mis = 0; \
+    _Pragma("GCC unroll 64") \
+    for (int i = 0; i < L; i++) \
+      if (!baseMatch(prim[i], gen[i])) { \
+        mis += WEIGHT(L, IDX); \
+        if (mis > allow) \
+          return 0.0f; \
+      } \
+    return (float) (max - mis) / max; \
+  }
+#define KERNELS(L) \
+  KERNEL(L, scoreFwd##L, i) \
+  KERNEL(L, scoreRev##L, L - 1 - i)
+
+KERNELS(17) KERNELS(18) KERNELS(19) KERNELS(20) KERNELS(21)
+KERNELS(22) KERNELS(23) KERNELS(24) KERNELS(25) KERNELS(26)
+KERNELS(27) KERNELS(28) KERNELS(29) KERNELS(30)
+
+static Kernel kernels[MAXKERN - MINKERN + 1][2] = {
+  { scoreFwd17, scoreRev17 }, { scoreFwd18, scoreRev18 },
+  { scoreFwd19, scoreRev19 }, { scoreFwd20, scoreRev20 },
+  { scoreFwd21, scoreRev21 }, { scoreFwd22, scoreRev22 },
+  { scoreFwd23, scoreRev23 }, { scoreFwd24, scoreRev24 },
+  { scoreFwd25, scoreRev25 }, { scoreFwd26, scoreRev26 },
+  { scoreFwd27, scoreRev27 }, { scoreFwd28, scoreRev28 },
+  { scoreFwd29, scoreRev29 }, { scoreFwd30, scoreRev30 }
+};
+
+/* Kernel getKernel()
+ * Selects the scoring kernel for a primer sequence.
+ */
+Kernel getKernel(char* prim, int rev) {
+  int len = strlen(prim);
+  if (len < MINKERN || len > MAXKERN)
+    return rev ? scoreRev : scoreFwd;
+  return kernels[len - MINKERN][rev];
+}
+
+/* int ampStart(), ampEnd()
+ * Return the coordinates of an amplicon.
+ */
+int ampStart(Match* m) {
+  return m->fpos > m->rpos ? m->rpos : m->fpos;
+}
+int ampEnd(Primer* p, Match* m) {
+  return m->fpos > m->rpos ? m->fpos + strlen(p->seq[1])
+    : m->rpos + strlen(p->seq[2]);
+}
+
+/* int better()
+ * Ranks two amplicons: higher combined score, then
+ *   length closer to the target.
+ */
+int better(Primer* p, Match* a, Match* b, int target) {
+  float sa = a->fmatch + a->rmatch, sb = b->fmatch + b->rmatch;
+  if (sa != sb)
+    return sa > sb;
+  return abs(ampEnd(p, a) - ampStart(a) - target)
+    < abs(ampEnd(p, b) - ampStart(b) - target);
+}
+
+/* void siftDown()
+ * Restores the heap (worst amplicon at the root) below
+ *   the given node.
+ */
+void siftDown(Primer* p, int n, int i, int target) {
+  Match** h = p->heap;
+  for (int c = 2 * i + 1; c < n; i = c, c = 2 * i + 1) {
+    if (c + 1 < n && better(p, h[c], h[c + 1], target))
+      c++;
+    if (!better(p, h[i], h[c], target))
+      break;
+    Match* temp = h[i];
+    h[i] = h[c];
+    h[c] = temp;
+  }
+}
+
+/* void siftUp()
+ * Restores the heap above the given node.
+ */
+void siftUp(Primer* p, int i, int target) {
+  Match** h = p->heap;
+  while (i > 0 && better(p, h[(i - 1) / 2], h[i], target)) {
+    Match* temp = h[i];
+    h[i] = h[(i - 1) / 2];
+    h[(i - 1) / 2] = temp;
+    i = (i - 1) / 2;
+  }
+}
+
+/* void saveAmp()
+ * Saves an amplicon, either to the primer's list or, with
+ *   topK > 0, to its heap of the K best amplicons.
+ */
+void saveAmp(Primer* p, Match* a, int topK, int target) {
+  if (!topK) {
+    Match* m = (Match*) memalloc(sizeof(Match));
+    *m = *a;
+    if (p->amp == NULL)
+      p->amp = m;
+    else
+      p->last->next = m;
+    p->last = m;
+  } else if (p->nheap < topK) {
+    if (p->heap == NULL)
+      p->heap = (Match**) memalloc(topK * sizeof(Match*));
+    Match* m = (Match*) memalloc(sizeof(Match));
+    *m = *a;
+    p->heap[p->nheap] = m;
+    siftUp(p, p->nheap++, target);
+  } else if (better(p, a, p->heap[0], target)) {
+    // replace worst amplicon
+    free(p->heap[0]->seq);
+    *p->heap[0] = *a;
+    siftDown(p, p->nheap, 0, target);
+  } else
+    free(a->seq);
+}
+
+/* void printLine()
+ * Prints one line of output.
+ */
+void printLine(FILE* out, char* chrom, int start, int end,
+    char* name, char strand, float fmatch, float rmatch,
+    char* outer) {
+  fprintf(out, "%s\t%d\t%d\t%s\t%c\t%.3f\t%.3f", chrom, start, end,
+    name, strand, fmatch, rmatch);
+  if (outer != NULL)
+    fprintf(out, "\t%s", outer);
+  fprintf(out, "\n");
+}
+
+/* int cmpKey()
+ * Orders amplicon records by chromosome, coordinates,
+ *   strand, and primer.
+ */
+int cmpKey(const Hit* x, const Hit* y) {
+  if (x->chrom != y->chrom)
+    return x->chrom < y->chrom ? -1 : 1;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  if (x->end != y->end)
+    return x->end < y->end ? -1 : 1;
+  if (x->strand != y->strand)
+    return x->strand < y->strand ? -1 : 1;
+  if (x->prim != y->prim)
+    return x->prim < y->prim ? -1 : 1;
+  return 0;
+}
+
+/* int cmpHit()
+ * Orders amplicon records as cmpKey(), then best score
+ *   first (for qsort).
+ */
+int cmpHit(const void* a, const void* b) {
+  const Hit* x = (const Hit*) a, *y = (const Hit*) b;
+  int res = cmpKey(x, y);
+  if (res)
+    return res;
+  float sx = x->fmatch + x->rmatch, sy = y->fmatch + y->rmatch;
+  return sx > sy ? -1 : sx < sy;
+}
+
+/* Sort* newSort()
+ * Creates an external sort of amplicons with the given
+ *   memory budget (in MB).
+ */
+Sort* newSort(int mb) {
+  Sort* s = (Sort*) memalloc(sizeof(Sort));
+  s->size = mb * (1048576 / sizeof(Hit));
+  s->cap = (s->size < SORTINIT ? s->size : SORTINIT);
+  s->buf = (Hit*) memalloc(s->cap * sizeof(Hit));
+  s->n = 0;
+  s->runs = (FILE**) memalloc(MAXRUNS * sizeof(FILE*));
+  s->nruns = 0;
+  return s;
+}
+
+/* void siftRun()
+ * Restores the heap of runs (lowest record at the root)
+ *   below the given node.
+ */
+void siftRun(int* heap, int n, int i, Hit* h) {
+  for (int c = 2 * i + 1; c < n; i = c, c = 2 * i + 1) {
+    if (c + 1 < n && cmpHit(h + heap[c + 1], h + heap[c]) < 0)
+      c++;
+    if (cmpHit(h + heap[i], h + heap[c]) <= 0)
+      break;
+    int temp = heap[i];
+    heap[i] = heap[c];
+    heap[c] = temp;
+  }
+}
+
+/* void mergeRuns()
+ * Merges the sorted runs, removing duplicates, and closes them.
+ *   Records are printed if prims is given, otherwise they are
+ *   written as a new run to out.
+ */
+void mergeRuns(Sort* s, FILE* out, Primer** prims, char** names,
+    Product* prod) {
+  Hit* h = (Hit*) memalloc((s->nruns + 1) * sizeof(Hit));
+  int* heap = (int*) memalloc((s->nruns + 1) * sizeof(int));
+  int n = 0;
+  for (int r = 0; r < s->nruns; r++)
+    if (fread(h + r, sizeof(Hit), 1, s->runs[r]) == 1)
+      heap[n++] = r;
+    else if (ferror(s->runs[r]))
+      exit(error(TMPREADERR, SPECERR));
+  for (int i = n / 2 - 1; i > -1; i--)
+    siftRun(heap, n, i, h);
+
+  Hit* last = h + s->nruns;
+  int first = 1;
+  while (n) {
+    int r = heap[0];
+    if (first || cmpKey(last, h + r)) {
+      if (prims != NULL)
+        printLine(out, names[h[r].chrom], h[r].start, h[r].end,
+          prims[h[r].prim]->name, h[r].strand, h[r].fmatch,
+          h[r].rmatch, h[r].outer == -1 ? NULL : prod[h[r].outer].id);
+      else if (fwrite(h + r, sizeof(Hit), 1, out) != 1)
+        exit(error(TMPWRITEERR, SPECERR));
+      *last = h[r];
+      first = 0;
+    }
+    if (fread(h + r, sizeof(Hit), 1, s->runs[r]) != 1) {
+      if (ferror(s->runs[r]))
+        exit(error(TMPREADERR, SPECERR));
+      heap[0] = heap[--n];
+    }
+    siftRun(heap, n, 0, h);
+  }
+
+  for (int r = 0; r < s->nruns; r++)
+    closeFile(s->runs[r]);
+  s->nruns = 0;
+  free(h);
+  free(heap);
+}
+
+/* FILE* openRun()
+ * Creates a temporary file for a sorted run in $TMPDIR (or
+ *   /tmp). It is unlinked at once, so it is removed on close.
+ */
+FILE* openRun(void) {
+  char* dir = getenv("TMPDIR");
+  if (dir == NULL || dir[0] == '\0')
+    dir = "/tmp";
+  char* path = (char*) memalloc(strlen(dir) + strlen(RUNFILE) + 2);
+  sprintf(path, "%s/%s", dir, RUNFILE);
+  int fd = mkstemp(path);
+  if (fd == -1)
+    exit(error(TMPERR, SPECERR));
+  unlink(path);
+  free(path);
+  FILE* f = fdopen(fd, "w+b");
+  if (f == NULL)
+    exit(error(TMPERR, SPECERR));
+  return f;
+}
+
+/* void writeRun()
+ * Sorts the in-memory records and writes them to disk.
+ */
+void writeRun(Sort* s) {
+  // merge runs into one when too many are open
+  if (s->nruns == MAXRUNS) {
+    FILE* f = openRun();
+    mergeRuns(s, f, NULL, NULL, NULL);
+    rewind(f);
+    s->runs[s->nruns++] = f;
+  }
+
+  qsort(s->buf, s->n, sizeof(Hit), cmpHit);
+  FILE* f = openRun();
+  if (fwrite(s->buf, sizeof(Hit), s->n, f) != s->n)
+    exit(error(TMPWRITEERR, SPECERR));
+  rewind(f);
+  s->runs[s->nruns++] = f;
+  s->n = 0;
+}
+
+/* void addHit()
+ * Adds an amplicon to the external sort.
+ */
+void addHit(Sort* s, Primer* p, Match* m) {
+  if (s->n == s->cap) {
+    if (s->cap < s->size) {
+      // grow buffer up to the memory budget
+      s->cap = (s->cap > s->size / 2 ? s->size : 2 * s->cap);
+      s->buf = (Hit*) memrealloc(s->buf, s->cap * sizeof(Hit));
+    } else
+      writeRun(s);
+  }
+  Hit* h = s->buf + s->n++;
+  h->chrom = m->chrom;
+  h->start = ampStart(m);
+  h->end = ampEnd(p, m);
+  h->prim = p->id;
+  h->fmatch = m->fmatch;
+  h->rmatch = m->rmatch;
+  h->outer = m->outer;
+  h->strand = (m->fpos > m->rpos ? '-' : '+');
+}
+
+/* void printSort()
+ * Prints the sorted amplicons, then frees the external sort.
+ */
+void printSort(FILE* out, Sort* s, Primer* head, char** names,
+    Product* prod) {
+  int n = 0;
+  for (Primer* p = head; p != NULL; p = p->next)
+    n++;
+  Primer** prims = (Primer**) memalloc((n + 1) * sizeof(Primer*));
+  for (Primer* p = head; p != NULL; p = p->next)
+    prims[p->id] = p;
+
+  if (s->n)
+    writeRun(s);
+  mergeRuns(s, out, prims, names, prod);
+
+  free(prims);
+  free(s->buf);
+  free(s->runs);
+  free(s);
+}
+
+/* void addMatch()
+ * Pairs a second-primer match with the pending first-primer
+ *   matches, saving any amplicons of valid length. With c->keep,
+ *   the amplicon sequences are copied from the chunk.
+ */
+void addMatch(Primer* p, int k, int pos, int len, float score,
+    Chrom* c, char* chunk, int off, int minLen, int maxLen,
+    int topK, int target) {
+  int end = pos + len;
+  if (end <= c->done)
+    return;
+  for (Match* m = p->first; m != NULL; m = m->next) {
+    // fwd-rev on plus strand (k == 2), rc-rev--rc-fwd on minus (k == 1)
+    int start = (k == 2 ? m->fpos : m->rpos);
+    if (start == -1 || start >= pos || end - start < minLen
+        || end - start > maxLen)
+      continue;
+    Match a;
+    a.fmatch = (k == 2 ? m->fmatch : score);
+    a.rmatch = (k == 2 ? score : m->rmatch);
+    a.fpos = (k == 2 ? start : pos);
+    a.rpos = (k == 2 ? pos : start);
+    a.chrom = c->idx;
+    a.seq = NULL;
+    a.outer = c->outer;
+    a.next = NULL;
+    if (c->keep) {
+      a.seq = (char*) memalloc(1 + end - start);
+      memcpy(a.seq, chunk + start - off, end - start);
+      a.seq[end - start] = '\0';
+    }
+
+    // update histograms
+    int bin = (int) ((a.fmatch + a.rmatch) / 2.0f * SCOREBINS);
+    p->shist[bin < SCOREBINS ? bin : SCOREBINS - 1]++;
+    p->lhist[(end - start - minLen) * LENBINS
+      / (maxLen - minLen + 1)]++;
+
+    // with nested rounds to come, pass all products forward
+    if (c->sort != NULL && !topK)
+      addHit(c->sort, p, &a);
+    else
+      saveAmp(p, &a, c->keep ? 0 : topK, target);
+  }
+}
+
+/* void scanSeq()
+ * Scores one sequence of a primer (p->seq[k]) along the chunk.
+ *   Windows lying within assembly gaps are skipped, and those
+ *   within soft-masked regions are weighted by maskWt.
+ */
+void scanSeq(Primer* p, int k, char* chunk, int len, int off,
+    int olap, Chrom* c, int minLen, int maxLen,
+    float minScore, float maskWt, int topK, int target) {
+  char* prim = p->seq[k];
+  int plen = strlen(prim);
+  int max = (k < 2 ? p->fmax : p->rmax);
+  float allow = (1.0f - minScore) * max;
+  Interval* gap = c->gap, *mask = c->mask;
+
+  // windows ending in the overlap were checked in the previous chunk
+  for (int j = (olap < plen ? 0 : olap - plen + 1);
+      j <= len - plen; j++) {
+    int pos = off + j;
+
+    // jump over assembly gaps
+    while (gap != NULL && gap->end < pos + plen)
+      gap = gap->next;
+    if (gap != NULL && gap->start <= pos) {
+      j = gap->end - plen - off;
+      continue;
+    }
+
+    // weight (or skip) soft-masked regions
+    float wt = 1.0f;
+    while (mask != NULL && mask->end < pos + plen)
+      mask = mask->next;
+    if (mask != NULL && mask->start <= pos) {
+      if (maskWt == 0.0f) {
+        j = mask->end - plen - off;
+        continue;
+      }
+      wt = maskWt;
+    }
+
+    float score = wt * p->kern[k](prim, chunk + j, plen, max,
+      allow);
+    if (score < minScore)
+      continue;
+
+    if (k == 0 || k == 3) {
+      // save first-primer match
+      Match* m = (Match*) memalloc(sizeof(Match));
+      m->fmatch = (k == 0 ? score : 0.0f);
+      m->rmatch = (k == 0 ? 0.0f : score);
+      m->fpos = (k == 0 ? pos : -1);
+      m->rpos = (k == 0 ? -1 : pos);
+      m->chrom = c->idx;
+      m->seq = NULL;
+      m->outer = -1;
+      m->next = p->first;
+      p->first = m;
+    } else
+      addMatch(p, k, pos, plen, score, c, chunk, off, minLen,
+        maxLen, topK, target);
+  }
+}
 
 /* void findMatch()
- * Find a primer match to the genome chunk.
+ * Find primer matches to the genome chunk.
  */
-void findMatch(Primer* p, char* chunk, int pos,
-    Match* dummy, int minLen, int maxLen, float minScore) {
+void findMatch(Primer* p, char* chunk, int len, int off,
+    int olap, Chrom* c, int minLen, int maxLen,
+    float minScore, float maskWt, int topK, int target) {
+  // remove first-primer matches too far upstream
+  for (Match** m = &p->first; *m != NULL; ) {
+    int pos = ((*m)->fpos == -1 ? (*m)->rpos : (*m)->fpos);
+    if (pos + maxLen < off) {
+      Match* temp = *m;
+      *m = temp->next;
+      free(temp);
+    } else
+      m = &(*m)->next;
+  }
+
   // check for first primer match (p->seq[0] or p->seq[3])
-  //for 
-  // p->fmax, p->rmax are maximum matches
+  scanSeq(p, 0, chunk, len, off, olap, c, minLen, maxLen,
+    minScore, maskWt, topK, target);
+  scanSeq(p, 3, chunk, len, off, olap, c, minLen, maxLen,
+    minScore, maskWt, topK, target);
+
+  // check for second primer match (p->seq[2] or p->seq[1])
+  scanSeq(p, 2, chunk, len, off, olap, c, minLen, maxLen,
+    minScore, maskWt, topK, target);
+  scanSeq(p, 1, chunk, len, off, olap, c, minLen, maxLen,
+    minScore, maskWt, topK, target);
+}
+
+/* void printAmp()
+ * Prints an amplicon.
+ */
+void printAmp(FILE* out, Primer* p, Match* m, char* chrom,
+    Product* prod) {
+  printLine(out, chrom, ampStart(m), ampEnd(p, m), p->name,
+    m->fpos > m->rpos ? '-' : '+', m->fmatch, m->rmatch,
+    m->outer == -1 ? NULL : prod[m->outer].id);
+}
+
+/* void printMatch()
+ * Prints the amplicons saved for each primer pair (or adds them
+ *   to the external sort), then frees them. The top-K amplicons
+ *   are printed best first.
+ */
+void printMatch(FILE* out, Primer* head, char** names,
+    Product* prod, int target, Sort* sort) {
+  for (Primer* p = head; p != NULL; p = p->next) {
+    for (Match* m = p->amp; m != NULL; m = m->next)
+      if (sort != NULL)
+        addHit(sort, p, m);
+      else
+        printAmp(out, p, m, names[m->chrom], prod);
+    freeMatches(&p->amp);
+
+    // heapsort: worst amplicons move to the end
+    for (int n = p->nheap - 1; n > 0; n--) {
+      Match* temp = p->heap[0];
+      p->heap[0] = p->heap[n];
+      p->heap[n] = temp;
+      siftDown(p, n, 0, target);
+    }
+    for (int i = 0; i < p->nheap; i++) {
+      if (sort != NULL)
+        addHit(sort, p, p->heap[i]);
+      else
+        printAmp(out, p, p->heap[i], names[p->heap[i]->chrom],
+          prod);
+      free(p->heap[i]->seq);
+      free(p->heap[i]);
+    }
+    p->nheap = 0;
+  }
+}
 
-  // check for second primer match
+/* int cmpCoord()
+ * Orders products by chromosome and coordinates.
+ */
+int cmpCoord(const Product* x, const Product* y) {
+  if (x->chrom != y->chrom)
+    return x->chrom < y->chrom ? -1 : 1;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  if (x->end != y->end)
+    return x->end < y->end ? -1 : 1;
+  return 0;
+}
 
+/* int cmpProd()
+ * Orders products as cmpCoord(), then by id (for qsort).
+ */
+int cmpProd(const void* a, const void* b) {
+  const Product* x = (const Product*) a, *y = (const Product*) b;
+  int res = cmpCoord(x, y);
+  return res ? res : strcmp(x->id, y->id);
 }
 
+/* void saveProd()
+ * Converts an amplicon into a product, taking its sequence.
+ */
+void saveProd(Product* d, Primer* p, Match* m, char** names,
+    Product* outer) {
+  d->chrom = m->chrom;
+  d->start = ampStart(m);
+  d->end = ampEnd(p, m);
+  d->seq = m->seq;
+  m->seq = NULL;
+
+  // id lists the primer and coordinates, then outer products
+  int len = snprintf(NULL, 0, "%s:%s:%d-%d", p->name,
+    names[d->chrom], d->start, d->end);
+  if (m->outer != -1)
+    len += 1 + strlen(outer[m->outer].id);
+  d->id = (char*) memalloc(1 + len);
+  sprintf(d->id, "%s:%s:%d-%d", p->name, names[d->chrom],
+    d->start, d->end);
+  if (m->outer != -1) {
+    strcat(d->id, "<");
+    strcat(d->id, outer[m->outer].id);
+  }
+}
+
+/* Product* getProducts()
+ * Collects the amplicons saved for each primer pair as products,
+ *   sorted and deduplicated by coordinates.
+ */
+Product* getProducts(Primer* head, char** names, Product* outer,
+    int* n) {
+  int size = 1;
+  for (Primer* p = head; p != NULL; p = p->next) {
+    for (Match* m = p->amp; m != NULL; m = m->next)
+      size++;
+    size += p->nheap;
+  }
+  Product* prod = (Product*) memalloc(size * sizeof(Product));
+
+  *n = 0;
+  for (Primer* p = head; p != NULL; p = p->next) {
+    for (Match* m = p->amp; m != NULL; m = m->next)
+      saveProd(prod + (*n)++, p, m, names, outer);
+    freeMatches(&p->amp);
+    for (int i = 0; i < p->nheap; i++) {
+      saveProd(prod + (*n)++, p, p->heap[i], names, outer);
+      free(p->heap[i]);
+    }
+    p->nheap = 0;
+  }
+
+  // remove duplicates (the lowest id is kept)
+  qsort(prod, *n, sizeof(Product), cmpProd);
+  int j = 0;
+  for (int i = 0; i < *n; i++)
+    if (j && !cmpCoord(prod + j - 1, prod + i)) {
+      free(prod[i].seq);
+      free(prod[i].id);
+    } else
+      prod[j++] = prod[i];
+  *n = j;
+  return prod;
+}
+
+/* void freeProducts()
+ * Frees an array of products.
+ */
+void freeProducts(Product* prod, int n) {
+  for (int i = 0; i < n; i++) {
+    free(prod[i].seq);
+    free(prod[i].id);
+  }
+  free(prod);
+}
+
+/* void printHist()
+ * Prints the histograms of amplicon counts per primer pair.
+ */
+void printHist(FILE* hist, Primer* head, int round, int minLen,
+    int maxLen) {
+  int width = maxLen - minLen + 1;
+  for (Primer* p = head; p != NULL; p = p->next) {
+    for (int i = 0; i < SCOREBINS; i++)
+      fprintf(hist, "%d\t%s\tscore\t%.2f-%.2f\t%d\n", round, p->name,
+        (float) i / SCOREBINS, (float) (i + 1) / SCOREBINS,
+        p->shist[i]);
+    for (int i = 0; i < LENBINS; i++) {
+      int lo = minLen + (i * width + LENBINS - 1) / LENBINS;
+      int hi = minLen + ((i + 1) * width + LENBINS - 1) / LENBINS - 1;
+      if (lo <= hi)
+        fprintf(hist, "%d\t%s\tlength\t%d-%d\t%d\n", round, p->name,
+          lo, hi, p->lhist[i]);
+    }
+  }
+}
+
+/* int countAmps()
+ * Returns the number of amplicons found for a set of primers.
+ */
+int countAmps(Primer* head) {
+  int count = 0;
+  for (Primer* p = head; p != NULL; p = p->next)
+    for (int i = 0; i < SCOREBINS; i++)
+      count += p->shist[i];
+  return count;
+}
 
 /* int readFile()
- * Parses the input file. Produces the output file(s).
+ * Parses the input file. Produces the output file(s), unless
+ *   the amplicons are kept for a nested round (keep).
  */
 int readFile(FILE* out, FILE* gen, Primer* head,
-    int minLen, int maxLen, float minScore) {
+    int minLen, int maxLen, float minScore, float maskWt,
+    int topK, int target, int keep, Sort* sort, char*** names) {
 
   char* chunk = (char*) memalloc(1 + CHUNK_SIZE);
-  char* chrom = (char*) memalloc(1 + MAX_PRIM);
-  Match* dummy = (Match*) memalloc(sizeof(Match));
+  char* chrom = (char*) memalloc(MAX_SIZE);
+  Chrom c = { 0, 0, 0, keep, -1, keep ? NULL : sort,
+    NULL, NULL, NULL, NULL };
+  int size = 16;
+  *names = (char**) memalloc(size * sizeof(char*));
 
+  // carry whole amplicons between chunks, for nested rounds
+  int carry = (keep && maxLen > MAX_PRIM ? maxLen : MAX_PRIM);
+
+  int idx = 0;
   getLine(line, MAX_SIZE, gen);
   while (line[0] == '>') {
 
     // save chromosome
     int i;
-    for (i = 0; line[i + 1] != '\n' &&
-        line[i + 1] != ' ' && i < MAX_PRIM; i++)
+    for (i = 0; line[i + 1] != '\0' && !isspace(line[i + 1]); i++)
       chrom[i] = line[i + 1];
     chrom[i] = '\0';
+    if (idx == size - 1) {
+      size *= 2;
+      *names = (char**) memrealloc(*names, size * sizeof(char*));
+    }
+    (*names)[idx] = (char*) memalloc(1 + i);
+    strcpy((*names)[idx], chrom);
 
     chunk[0] = '\0';     // reset chunk
-    dummy = NULL;        // reset list of matches for next chunk
+    c.idx = idx;
+    c.len = 0;
 
-    int count = 0;
     int pos = 0;
+    int olap = 0;
     int next = 1;
     while (next) {
 
       // load next chunk of genome
-      next = getChunk(chunk, CHUNK_SIZE - MAX_PRIM, gen);
+      next = getChunk(chunk, CHUNK_SIZE - carry, gen, &c,
+        maskWt < 1.0f);
+      trimInt(&c.gap, &c.gapEnd, pos);
+      trimInt(&c.mask, &c.maskEnd, pos);
 
+      int len = strlen(chunk);
       for (Primer* p = head; p != NULL; p = p->next)
-        findMatch(p, chunk, pos, dummy, minLen, maxLen, minScore);
-
-//printf("chunk is %s\n%s\n", chunk, chrom);
-//free(chrom);
-//while (!getchar()) ;
+        findMatch(p, chunk, len, pos, olap, &c, minLen,
+          maxLen, minScore, maskWt, topK, target);
 
-//printf("chunk is\n%s\n", chunk);
-//while (!getchar()) ;
-      pos += CHUNK_SIZE - MAX_PRIM;
-      count++;
+      pos += CHUNK_SIZE - carry;
+      olap = carry;
     }
 
-printf("chromosome %s, chunks of %dbp: %d\n", chrom, CHUNK_SIZE, count);
-printf("last chunk is %s (%dbp)\n", chunk, (int) strlen(chunk));
-while (!getchar()) ;
-
+    for (Primer* p = head; p != NULL; p = p->next)
+      freeMatches(&p->first);
+    if (!keep && !topK)
+      printMatch(out, head, *names, NULL, target, c.sort);
+    trimInt(&c.gap, &c.gapEnd, c.len);
+    trimInt(&c.mask, &c.maskEnd, c.len);
+    idx++;
   }
+  (*names)[idx] = NULL;
+  if (!keep)
+    printMatch(out, head, *names, NULL, target, c.sort);
 
   // free memory
   free(chunk);
   free(chrom);
 
-  return 0;
+  return countAmps(head);
+}
+
+/* int nestRound()
+ * Finds primer matches within the products of the previous
+ *   round of a nested PCR.
+ */
+int nestRound(FILE* out, Primer* head, Product* prod, int n,
+    char** names, int minLen, int maxLen, float minScore,
+    int topK, int target, int keep, Sort* sort) {
+  Chrom c = { -1, 0, 0, keep, -1, keep ? NULL : sort,
+    NULL, NULL, NULL, NULL };
+  for (int i = 0; i < n; i++) {
+    // amplicons within earlier (overlapping) products were found
+    if (prod[i].chrom != c.idx) {
+      c.idx = prod[i].chrom;
+      c.done = 0;
+    }
+    c.outer = i;
+    c.len = prod[i].end - prod[i].start;
+
+    for (Primer* p = head; p != NULL; p = p->next) {
+      freeMatches(&p->first);
+      findMatch(p, prod[i].seq, c.len, prod[i].start, 0, &c,
+        minLen, maxLen, minScore, 1.0f, topK, target);
+    }
+    if (prod[i].end > c.done)
+      c.done = prod[i].end;
+  }
+
+  for (Primer* p = head; p != NULL; p = p->next)
+    freeMatches(&p->first);
+  if (!keep)
+    printMatch(out, head, names, prod, target, c.sort);
+  return countAmps(head);
 }
 
 /* int calcMax()
@@ -321,18 +1172,8 @@ while (!getchar()) ;
 int calcMax(char* prim) {
   int match = 0;
   int len = strlen(prim);
-  for (int i = len - 1; i > -1; i--) {
-    int val = 21 - len + i;
-    if (val > 19)
-      val *= 5;
-    else if (val > 10)
-      val *= 3;
-    else if (val > 0)
-      val *= 2;
-    else
-      val = 1;
-    match += val;
-  }
+  for (int i = len - 1; i > -1; i--)
+    match += weight(len, i);
   return match;
 }
 
@@ -342,6 +1183,7 @@ int calcMax(char* prim) {
 Primer* loadSeqs(FILE* prim) {
 
   Primer* head = NULL, *prev = NULL;
+  int id = 0;
   while (fgets(line, MAX_SIZE, prim) != NULL) {
 
     if (line[0] == '#')
@@ -356,6 +1198,9 @@ Primer* loadSeqs(FILE* prim) {
       continue;
     }
 
+    if (strlen(fwd) > MAX_PRIM || strlen(rev) > MAX_PRIM)
+      exit(error(PLENERR, SPECERR));
+
     // check for duplicate
     for (Primer* pc = head; pc != NULL; pc = pc->next)
       if (!strcmp(pc->name, name))
@@ -369,6 +1214,7 @@ Primer* loadSeqs(FILE* prim) {
     p->seq[2] = (char*) memalloc(1 + strlen(rev));  // rev primer
     p->seq[3] = (char*) memalloc(1 + strlen(rev));  // rev-comp of rev primer
     strcpy(p->name, name);
+    p->id = id++;
     strcpy(p->seq[0], fwd);
     strcpy(p->seq[2], rev);
 
@@ -380,6 +1226,17 @@ Primer* loadSeqs(FILE* prim) {
     p->fmax = calcMax(p->seq[0]);
     p->rmax = calcMax(p->seq[2]);
 
+    // select scoring kernels (3' end on the left for seq[1], seq[2])
+    for (int i = 0; i < 4; i++)
+      p->kern[i] = getKernel(p->seq[i], i == 1 || i == 2);
+
+    p->first = NULL;
+    p->amp = NULL;
+    p->last = NULL;
+    p->heap = NULL;
+    p->nheap = 0;
+    memset(p->shist, 0, sizeof(p->shist));
+    memset(p->lhist, 0, sizeof(p->lhist));
     p->next = NULL;
     if (head == NULL)
       head = p;
@@ -398,12 +1255,14 @@ Primer* loadSeqs(FILE* prim) {
  * Opens the files to run the program.
  */
 void openFiles(char* outFile, FILE** out,
-    char* primFile, FILE** prim, char* genFile, FILE** gen,
+    char** primFile, FILE** prim, int rounds,
+    char* genFile, FILE** gen,
     char* logFile, FILE** log, char* doveFile, FILE** dove,
     int dovetail) {
-  // open required files
+  // open required files (one primer file per round)
   *out = openFile(outFile, WRITE);
-  *prim = openFile(primFile, READ);
+  for (int i = 0; i < rounds; i++)
+    prim[i] = openFile(primFile[i], READ);
   *gen = openFile(genFile, READ);
 
   // open optional files
@@ -422,12 +1281,16 @@ void openFiles(char* outFile, FILE** out,
  */
 void getParams(int argc, char** argv) {
 
-  char* outFile = NULL, *primFile = NULL, *genFile = NULL,
-    *logFile = NULL,
+  char* outFile = NULL, *genFile = NULL,
+    *logFile = NULL, *histFile = NULL,
     *doveFile = NULL;
   int minLen = DEFMIN, maxLen = DEFMAX;
-  float minScore = DEFSCORE;
+  int topK = DEFTOPK, target = 0, sortMem = 0;
+  int setTarget = 0, setSort = 0;
+  float minScore = DEFSCORE, maskWt = DEFMASK;
   int verbose = 0;
+  char** primFile = (char**) memalloc(argc * sizeof(char*));
+  int rounds = 0;
 
   // parse argv
   for (int i = 1; i < argc; i++) {
@@ -441,7 +1304,7 @@ void getParams(int argc, char** argv) {
       if (!strcmp(argv[i], OUTFILE))
         outFile = argv[++i];
       else if (!strcmp(argv[i], PRIMFILE))
-        primFile = argv[++i];
+        primFile[rounds++] = argv[++i];
       else if (!strcmp(argv[i], GENFILE))
         genFile = argv[++i];
       else if (!strcmp(argv[i], MINLEN))
@@ -455,66 +1318,159 @@ void getParams(int argc, char** argv) {
         doveFile = argv[++i];
       else if (!strcmp(argv[i], MINSCORE))
         minScore = getFloat(argv[++i]);
-      else
+      else if (!strcmp(argv[i], MASKWT))
+        maskWt = getFloat(argv[++i]);
+      else if (!strcmp(argv[i], TOPK))
+        topK = getInt(argv[++i]);
+      else if (!strcmp(argv[i], TARGET)) {
+        target = getInt(argv[++i]);
+        setTarget = 1;
+      } else if (!strcmp(argv[i], HISTFILE))
+        histFile = argv[++i];
+      else if (!strcmp(argv[i], SORTMEM)) {
+        sortMem = getInt(argv[++i]);
+        setSort = 1;
+      } else
         exit(error(argv[i], ERRPARAM));
     } else
       usage();
   }
 
   // check for parameter errors
-  if (outFile == NULL || primFile == NULL || genFile == NULL)
+  if (outFile == NULL || !rounds || genFile == NULL)
     usage();
   if (minLen > maxLen)
     exit(error(LENERR, SPECERR));
+  if (rounds > 1 && maxLen > CHUNK_SIZE / 2)
+    exit(error(MAXLENERR, SPECERR));
   if (minScore <= 0 || minScore > 1)
     exit(error(SCOREERR, SPECERR));
+  if (maskWt < 0 || maskWt > 1)
+    exit(error(MASKERR, SPECERR));
+  if (topK < 0)
+    exit(error(TOPKERR, SPECERR));
+  if (setSort && (sortMem < 1 || sortMem > MAXSORT))
+    exit(error(SORTERR, SPECERR));
+  if (target < 0)
+    exit(error(TARGETERR, SPECERR));
+  if (!setTarget)
+    target = (minLen + maxLen) / 2;
 
   // open files
-  FILE* out = NULL, *prim = NULL, *gen = NULL,
-    *log = NULL, *dove = NULL;
+  FILE* out = NULL, *gen = NULL,
+    *log = NULL, *dove = NULL, *hist = NULL;
+  FILE** prim = (FILE**) memalloc(rounds * sizeof(FILE*));
 int dovetail = 0;
-  openFiles(outFile, &out, primFile, &prim, genFile, &gen,
+  openFiles(outFile, &out, primFile, prim, rounds, genFile, &gen,
     logFile, &log,
     doveFile, &dove, dovetail);
-  Primer* head = loadSeqs(prim);
-/*
-  for (Primer* p = primo; p != NULL; p = p->next) {
-    printf("%s\t%s\t%s\n\t%s\t%s\n", p->name, p->fwd, p->rev, p->frc, p->rrc);
-    while (!getchar()) ;
+  if (histFile != NULL) {
+    hist = openFile(histFile, WRITE);
+    fprintf(hist, "Round\tPrimer\tHistogram\tBin\tCount\n");
   }
 
-printf("Primer %s, score %d\nPrimer %s, score %d\n", p->fwd, p->fmax, p->rev, p->rmax);
-while (!getchar()) ;
-*/
-
+  // read file, then search products of each round with the next
+  Primer* head = NULL;
+  Product* prod = NULL;
+  int n = 0;
+  char** names = NULL;
+  Sort* sort = (setSort ? newSort(sortMem) : NULL);
+  for (int r = 0; r < rounds; r++) {
+    int keep = (r < rounds - 1);
+    if (r) {
+      Product* outer = prod;
+      int m = n;
+      prod = getProducts(head, names, outer, &n);
+      freeProducts(outer, m);
+      freeMemory(head);
+    }
+    head = loadSeqs(prim[r]);
 
-  // read file
-  int stitch = 0, fail = 0;  // counting variables
-  int count = readFile(out, gen, head, minLen, maxLen, minScore);
+    int count = (r ? nestRound(out, head, prod, n, names, minLen,
+      maxLen, minScore, topK, target, keep, sort)
+      : readFile(out, gen, head, minLen, maxLen, minScore, maskWt,
+      topK, target, keep, sort, &names));
 
-  if (verbose) {
-    printf("Reads analyzed: %d\n", count);
-    printf("  Successfully stitched: %d\n", stitch);
-    printf("  Stitch failures: %d\n", fail);
+    if (verbose) {
+      if (rounds > 1)
+        printf("Round %d: ", r + 1);
+      printf("Amplicons found: %d\n", count);
+    }
+    if (hist != NULL)
+      printHist(hist, head, r + 1, minLen, maxLen);
   }
+  if (sort != NULL)
+    printSort(out, sort, head, names, prod);
 
   // close files
   closeFile(out);
   closeFile(gen);
-  if (log != NULL);
+  if (hist != NULL)
+    closeFile(hist);
+  if (log != NULL)
     closeFile(log);
   if (dovetail && doveFile != NULL)
     closeFile(dove);
 
+  freeProducts(prod, n);
   freeMemory(head);
+  for (int i = 0; names[i] != NULL; i++)
+    free(names[i]);
+  free(names);
+  free(prim);
+  free(primFile);
+}
+
+#ifdef BENCH
+/* void bench()
+ * Times the generic kernel against the unrolled kernel for each
+ *   primer length in [MINKERN,MAXKERN] (make bench).
+ */
+void bench(void) {
+  int len = 1 << 20, reps = 20;
+  char* gen = (char*) memalloc(len + 1);
+  char prim[MAXKERN + 1];
+  srand(1);
+  for (int i = 0; i < len; i++)
+    gen[i] = "ACGT"[rand() % 4];
+  gen[len] = '\0';
+
+  printf("Length\tGeneric(ns)\tUnrolled(ns)\tSpeedup\n");
+  for (int L = MINKERN; L <= MAXKERN; L++) {
+    for (int i = 0; i < L; i++)
+      prim[i] = "ACGTN"[rand() % 5 ? rand() % 4 : 4];
+    prim[L] = '\0';
+    int max = calcMax(prim);
+    float allow = (1.0f - DEFSCORE) * max;
+    Kernel kern[2] = { scoreFwd, getKernel(prim, 0) };
+    double ns[2];
+    float sum[2] = { 0.0f, 0.0f };
+    for (int k = 0; k < 2; k++) {
+      clock_t start = clock();
+      for (int r = 0; r < reps; r++)
+        for (int j = 0; j <= len - L; j++)
+          sum[k] += kern[k](prim, gen + j, L, max, allow);
+      ns[k] = 1e9 * (clock() - start) / CLOCKS_PER_SEC
+        / ((double) reps * (len - L + 1));
+    }
+    if (sum[0] != sum[1])
+      exit(error("Kernels disagree", SPECERR));
+    printf("%d\t%.2f\t%.2f\t%.2fx\n", L, ns[0], ns[1], ns[0] / ns[1]);
+  }
+  free(gen);
 }
+#endif
 
 /* int main()
  * Main.
  */
 int main(int argc, char* argv[]) {
   line = (char*) memalloc(MAX_SIZE);
+#ifdef BENCH
+  bench();
+#else
   getParams(argc, argv);
+#endif
   free(line);
   return 0;
 }
@@ -6,9 +6,9 @@
 */
 
 #define MAX_SIZE    1024    // maximum length for input line
-#define CHUNK_SIZE  50     // maximum chunk of genome to analyze
-//#define CHUNK_SIZE  65536   // maximum chunk of genome to analyze
-#define MAX_PRIM    10      // maximum primer length
+//#define CHUNK_SIZE  50     // maximum chunk of genome to analyze
+#define CHUNK_SIZE  65536   // maximum chunk of genome to analyze
+#define MAX_PRIM    40      // maximum primer length
 #define CSV         ",\t"   // delimiter for primer file
 #define DEL         ",\t\n"
 
@@ -20,6 +20,11 @@
 #define MINLEN      "-m"
 #define MAXLEN      "-M"
 #define MINSCORE    "-s"
+#define MASKWT      "-w"
+#define TOPK        "-k"
+#define TARGET      "-t"
+#define HISTFILE    "-hf"
+#define SORTMEM     "-b"
 
 #define LOGFILE     "-l"
 #define DOVEOPT     "-d"
@@ -31,6 +36,22 @@
 #define DEFMIN      60     // minimum amplicon length
 #define DEFMAX      300    // maximum amplicon length
 #define DEFSCORE    0.75f  // primer-genome match score
+#define DEFMASK     1.0f   // score weight in soft-masked regions
+#define DEFTOPK     0      // amplicons kept per primer pair (0 = all)
+
+// specialized scoring kernels
+#define MINKERN     17     // shortest primer with an unrolled kernel
+#define MAXKERN     30     // longest primer with an unrolled kernel
+
+// external sort of amplicons
+#define MAXSORT     2047   // maximum memory budget (MB)
+#define MAXRUNS     256    // sorted runs on disk before an extra merge
+#define SORTINIT    4096   // initial records in the sort buffer
+#define RUNFILE     "PCRSim.XXXXXX"  // template for sorted run files
+
+// histogram bins
+#define SCOREBINS   20     // bins of mean primer score in [0,1]
+#define LENBINS     20     // bins of amplicon length in [minLen,maxLen]
 
 // third parameter to copyStr()
 #define FWD         0
@@ -40,22 +61,92 @@
 // custom error messages
 #define LENERR      "Min. amplicon length cannot be larger than max."
 #define SCOREERR    "Min. score must be in (0,1]"
+#define MASKERR     "Soft-mask weight must be in [0,1]"
+#define PLENERR     "Primer length exceeds MAX_PRIM"
+#define MAXLENERR   "Max. amplicon length for nested PCR cannot exceed half of CHUNK_SIZE"
+#define TMPERR      "Cannot create temporary file"
+#define TMPREADERR  "Cannot read from temporary file"
+#define TMPWRITEERR "Cannot write to temporary file"
+#define SORTERR     "Memory budget for sorting must be in [1,2047] MB"
+#define TARGETERR   "Target amplicon length cannot be negative"
+#define TOPKERR     "Number of amplicons to keep cannot be negative"
 
 // structs
+typedef struct interval {
+  int start;
+  int end;     // exclusive
+  struct interval* next;
+} Interval;
+
+// fixed-width amplicon record for external sorting
+typedef struct hit {
+  int chrom;
+  int start;
+  int end;
+  int strand;   // '+' or '-'
+  int prim;     // primer index
+  int outer;    // index of outer product (nested PCR), or -1
+  float fmatch;
+  float rmatch;
+} Hit;
+
+typedef struct sort {
+  Hit* buf;     // in-memory records
+  int n;
+  int cap;      // records allocated
+  int size;     // records allowed by the memory budget
+  FILE** runs;  // sorted runs on disk
+  int nruns;
+} Sort;
+
+typedef struct chrom {
+  int idx;            // chromosome index
+  int len;            // number of bases loaded
+  int done;           // amplicons ending here were already found
+  int keep;           // save amplicon sequences (nested PCR)
+  int outer;          // index of outer product scanned (nested PCR)
+  Sort* sort;         // external sort of amplicons (or NULL)
+  Interval* gap;      // runs of Ns
+  Interval* gapEnd;
+  Interval* mask;     // soft-masked (lowercase) runs
+  Interval* maskEnd;
+} Chrom;
+
 typedef struct match {
   float fmatch;
   float rmatch;
   int fpos;
   int rpos;
   int chrom;
+  char* seq;    // amplicon sequence (nested PCR)
+  int outer;    // index of outer product (nested PCR), or -1
   struct match* next;
 } Match;
 
+typedef struct product {
+  int chrom;
+  int start;
+  int end;
+  char* seq;
+  char* id;     // primer and coordinates, then outer products
+} Product;
+
+// primer-genome scoring function
+typedef float (*Kernel)(char*, char*, int, int, float);
+
 typedef struct primer {
   char* name;
+  int id;
   char* seq[4];
   int fmax;    // max. match score for fwd primer
   int rmax;    // max. match score for rev primer
-  Match* first;
+  Kernel kern[4];  // scoring kernels for seq[]
+  Match* first;  // pending first-primer matches
+  Match* amp;    // amplicons found
+  Match* last;
+  Match** heap;  // top-K amplicons (worst at root)
+  int nheap;
+  int shist[SCOREBINS];  // amplicon counts by mean score
+  int lhist[LENBINS];    // amplicon counts by length
   struct primer* next;
 } Primer;
@@ -66,6 +66,16 @@ void* memalloc(int size) {
   return ans;
 }
 
+/* void* memrealloc()
+ * Resizes a heap block.
+ */
+void* memrealloc(void* ptr, int size) {
+  void* ans = realloc(ptr, size);
+  if (ans == NULL)
+    exit(error("", ERRMEM));
+  return ans;
+}
+
 /* int getInt(char*)
  * Converts the given char* to an int.
  */
@@ -9,6 +9,7 @@ int error(char*, int);            // prints an error message
 FILE* openFile(char*, char*);     // wrapper for fopen()
 void closeFile(FILE*);            // wrapper for fclose()
 void* memalloc(int);              // wrapper for malloc()
+void* memrealloc(void*, int);     // wrapper for realloc()
 float getFloat(char*);            // wrapper for strtof()
 int getInt(char*);                // wrapper for strtol()
 void getLine(char*, int, FILE*);  // wrapper for fgets()